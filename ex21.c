@@ -5,45 +5,138 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <float.h>
 
 #define CACHE_SIZE 1024
-#define ARG_COUNT  3
+#define BUF_SIZE   1024
+#define FILE_COUNT 2
 #define ERROR      -1
 #define SUCCESS    0
 
+#define BATCH_FLAG "--batch"
+#define JOBS_FLAG  "--jobs"
+#define LIST_FLAG  "--list"
+#define STDIN_PATH "-"
+#define ABS_EPS_FLAG "--abs-eps"
+#define REL_EPS_FLAG "--rel-eps"
+
+#define TOKEN_BLOCK_SIZE   65536
+#define MAX_MANTISSA_DIGITS 19
+#define MAX_EXACT_POWER     22
+#define MAX_EXPONENT        1000
+
+typedef enum {
+    FALSE = 0,
+    TRUE
+} bool;
+
 typedef struct {
     int fd;
     char cache[CACHE_SIZE];
     unsigned int pos;
     unsigned int cache_len;
+    bool failed;
 } OpenFile;
 
-typedef enum {
-    FALSE = 0,
-    TRUE
-} bool;
-
 typedef enum {
     IDENTICAL = 1,
     DIFFERENT,
     SIMILAR
 } CompareStatus;
 
+// numeric tolerance for the token comparison, only used when one of the eps flags was given
+typedef struct {
+    double abs_eps;
+    double rel_eps;
+    bool enabled;
+} Tolerance;
+
+// whitespace separated tokens read a block at a time, either from fd or from data already in memory
+typedef struct {
+    int fd;
+    char *data;
+    size_t len;
+    size_t pos;
+    size_t capacity;
+    bool reached_eof;
+    bool failed;
+    bool owns_data;
+} Tokenizer;
+
+// expected file loaded once for batch mode, along with its whitespace-stripped upper-cased form
+typedef struct {
+    char *data;
+    size_t len;
+    char *normalized;
+    size_t normalized_len;
+} ExpectedFile;
+
+typedef struct {
+    ExpectedFile *expected;
+    char **paths;
+    CompareStatus *results;
+    Tolerance *tolerance;
+    size_t count;
+    size_t next;
+    pthread_mutex_t lock;
+} BatchJob;
+
 int reset_file(OpenFile *file);
 int open_file(OpenFile *file, char *file_path);
 bool read_from_file(OpenFile *file, char *ch);
-CompareStatus compare_files(OpenFile *file_1, OpenFile *file_2);
+CompareStatus compare_files(OpenFile *file_1, OpenFile *file_2, Tolerance *tolerance);
 bool are_identical(OpenFile *file_1, OpenFile *file_2);
 bool are_similar(OpenFile *file_1, OpenFile *file_2);
 char upper(char ch);
+int run_batch(int argc, char *argv[]);
+int load_expected(ExpectedFile *expected, char *file_path);
+void free_expected(ExpectedFile *expected);
+CompareStatus compare_to_expected(ExpectedFile *expected, char *file_path, Tolerance *tolerance);
+bool is_identical_to(OpenFile *file, ExpectedFile *expected);
+bool is_similar_to(OpenFile *file, ExpectedFile *expected);
+int read_path_list(int fd, char ***paths, size_t *count, size_t *capacity);
+int add_path(char ***paths, size_t *count, size_t *capacity, char *path);
+void *batch_worker(void *arg);
+const char *get_status_name(CompareStatus status);
+bool is_tolerance_flag(char *flag);
+int set_tolerance(Tolerance *tolerance, char *flag, char *value);
+int init_tokenizer(Tokenizer *tokenizer, int fd);
+void init_buffer_tokenizer(Tokenizer *tokenizer, char *data, size_t len);
+void free_tokenizer(Tokenizer *tokenizer);
+bool next_token(Tokenizer *tokenizer, char **token, size_t *token_len);
+bool parse_number(const char *token, size_t len, double *value);
+bool tokens_match(char *token_1, size_t len_1, char *token_2, size_t len_2, Tolerance *tolerance);
+CompareStatus are_within_tolerance(Tokenizer *tokenizer_1, Tokenizer *tokenizer_2, Tolerance *tolerance);
+CompareStatus are_similar_tokens(Tokenizer *tokenizer_1, Tokenizer *tokenizer_2);
+CompareStatus compare_with_tolerance(OpenFile *file_1, OpenFile *file_2, Tolerance *tolerance);
+void rewind_tokenizer(Tokenizer *tokenizer);
+CompareStatus are_identical_blocks(int fd_1, int fd_2, char *buffer_1, char *buffer_2, size_t size);
+ssize_t read_block(int fd, char *buffer, size_t size);
+bool have_same_size(int fd, size_t len);
 
 int main(int argc, char *argv[]) {
-    if (argc != ARG_COUNT) {
+    if (argc > 1 && strcmp(argv[1], BATCH_FLAG) == 0) {
+        return run_batch(argc, argv);
+    }
+
+    Tolerance tolerance = { 0, 0, FALSE };
+    int arg = 1;
+    while (arg < argc && is_tolerance_flag(argv[arg])) {
+        if (arg + 1 >= argc || set_tolerance(&tolerance, argv[arg], argv[arg + 1]) == ERROR) {
+            return ERROR;
+        }
+        arg += 2;
+    }
+
+    if (argc - arg != FILE_COUNT) {
         return ERROR;
     }
 
-    char *file_path_1 = argv[1];
-    char *file_path_2 = argv[2];
+    char *file_path_1 = argv[arg];
+    char *file_path_2 = argv[arg + 1];
 
     OpenFile file_1, file_2;
     if (open_file(&file_1, file_path_1) == ERROR) {
@@ -54,7 +147,7 @@ int main(int argc, char *argv[]) {
         return ERROR;
     }
 
-    CompareStatus result = compare_files(&file_1, &file_2);
+    CompareStatus result = compare_files(&file_1, &file_2, &tolerance);
     close(file_1.fd);
     close(file_2.fd);
     return result;
@@ -119,18 +212,20 @@ int open_file(OpenFile *file, char *file_path) {
     file->fd = fd;
     file->pos = 0;
     file->cache_len = 0;
+    file->failed = FALSE;
 
     return SUCCESS;
 }
 
-// returns FALSE if reached end-of-file
+// returns FALSE if reached end-of-file, or if the read failed with 'failed' set
 bool read_from_file(OpenFile *file, char *ch) {
     // did we reach all of the characters in our cache?
     if (file->pos >= file->cache_len) {
         // read up to CACHE_SIZE characters into cache
         ssize_t byte_count = read(file->fd, file->cache, CACHE_SIZE);
-        if (byte_count == 0) {
-            // reached end-of-file
+        if (byte_count <= 0) {
+            // reached end-of-file, or the read failed
+            file->failed = byte_count == ERROR;
             return FALSE;
         }
 
@@ -154,20 +249,857 @@ int reset_file(OpenFile *file) {
     }
     file->cache_len = 0;
     file->pos = 0;
+    file->failed = FALSE;
+    return SUCCESS;
 }
 
-CompareStatus compare_files(OpenFile *file_1, OpenFile *file_2) {
+CompareStatus compare_files(OpenFile *file_1, OpenFile *file_2, Tolerance *tolerance) {
+    if (tolerance->enabled) {
+        return compare_with_tolerance(file_1, file_2, tolerance);
+    }
+
     if (are_identical(file_1, file_2)) {
         return IDENTICAL;
     }
 
-    if (reset_file(file_1) == ERROR || reset_file(file_2) == ERROR) {
+    if (file_1->failed || file_2->failed || reset_file(file_1) == ERROR || reset_file(file_2) == ERROR) {
         return ERROR;
     }
 
     if (are_similar(file_1, file_2)) {
         return SIMILAR;
     }
-    
-    return DIFFERENT;
+
+    return file_1->failed || file_2->failed ? ERROR : DIFFERENT;
+}
+
+// tolerance mode reads each file once in the common case: the identical pass only runs when the
+// sizes match, and the character based similar pass only runs when the token pass fails
+CompareStatus compare_with_tolerance(OpenFile *file_1, OpenFile *file_2, Tolerance *tolerance) {
+    Tokenizer tokenizer_1, tokenizer_2;
+    if (init_tokenizer(&tokenizer_1, file_1->fd) == ERROR) {
+        return ERROR;
+    }
+    if (init_tokenizer(&tokenizer_2, file_2->fd) == ERROR) {
+        free_tokenizer(&tokenizer_1);
+        return ERROR;
+    }
+
+    CompareStatus result = DIFFERENT;
+    struct stat file_stat;
+    if (fstat(file_2->fd, &file_stat) == ERROR) {
+        result = ERROR;
+    } else if (!S_ISREG(file_stat.st_mode) || have_same_size(file_1->fd, file_stat.st_size)) {
+        result = are_identical_blocks(file_1->fd, file_2->fd, tokenizer_1.data, tokenizer_2.data, TOKEN_BLOCK_SIZE);
+        if (result == DIFFERENT && (reset_file(file_1) == ERROR || reset_file(file_2) == ERROR)) {
+            result = ERROR;
+        }
+    }
+
+    if (result == DIFFERENT) {
+        result = are_within_tolerance(&tokenizer_1, &tokenizer_2, tolerance);
+    }
+
+    // whitespace inside a token can still make the files similar
+    if (result == DIFFERENT) {
+        if (reset_file(file_1) == ERROR || reset_file(file_2) == ERROR) {
+            result = ERROR;
+        } else {
+            rewind_tokenizer(&tokenizer_1);
+            rewind_tokenizer(&tokenizer_2);
+            result = are_similar_tokens(&tokenizer_1, &tokenizer_2);
+        }
+    }
+
+    free_tokenizer(&tokenizer_1);
+    free_tokenizer(&tokenizer_2);
+    return result;
+}
+
+// regular files of another size can't be identical, anything else has to be read to find out
+bool have_same_size(int fd, size_t len) {
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == ERROR || !S_ISREG(file_stat.st_mode)) {
+        return TRUE;
+    }
+    return (size_t) file_stat.st_size == len;
+}
+
+// reads until the buffer is full or the file ends
+ssize_t read_block(int fd, char *buffer, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t byte_count = read(fd, buffer + total, size - total);
+        if (byte_count == ERROR) {
+            return ERROR;
+        }
+        if (byte_count == 0) {
+            break;
+        }
+        total += byte_count;
+    }
+    return total;
+}
+
+CompareStatus are_identical_blocks(int fd_1, int fd_2, char *buffer_1, char *buffer_2, size_t size) {
+    while (TRUE) {
+        ssize_t byte_count_1 = read_block(fd_1, buffer_1, size);
+        ssize_t byte_count_2 = read_block(fd_2, buffer_2, size);
+        if (byte_count_1 == ERROR || byte_count_2 == ERROR) {
+            return ERROR;
+        }
+        if (byte_count_1 != byte_count_2 || memcmp(buffer_1, buffer_2, byte_count_1) != 0) {
+            return DIFFERENT;
+        }
+        if (byte_count_1 == 0) {
+            return IDENTICAL;
+        }
+    }
+}
+
+// batch mode: comp.out --batch [--jobs N] [--list FILE] [--abs-eps E] [--rel-eps E] expected [candidate ...]
+// candidates come from argv, from the list file, or from stdin when neither is given.
+// writes one "path,VERDICT" line per candidate, in input order.
+int run_batch(int argc, char *argv[]) {
+    int jobs = 1;
+    char *list_path = NULL;
+    Tolerance tolerance = { 0, 0, FALSE };
+    int arg = 2;
+    while (arg < argc && strncmp(argv[arg], "--", 2) == 0) {
+        if (strcmp(argv[arg], JOBS_FLAG) == 0 && arg + 1 < argc) {
+            char *end;
+            long value = strtol(argv[arg + 1], &end, 10);
+            if (end == argv[arg + 1] || *end != '\0' || value < 1 || value > INT_MAX) {
+                return ERROR;
+            }
+            jobs = value;
+        } else if (strcmp(argv[arg], LIST_FLAG) == 0 && arg + 1 < argc) {
+            list_path = argv[arg + 1];
+        } else if (is_tolerance_flag(argv[arg]) && arg + 1 < argc) {
+            if (set_tolerance(&tolerance, argv[arg], argv[arg + 1]) == ERROR) {
+                return ERROR;
+            }
+        } else {
+            return ERROR;
+        }
+        arg += 2;
+    }
+    if (arg >= argc || jobs < 1) {
+        return ERROR;
+    }
+
+    ExpectedFile expected;
+    if (load_expected(&expected, argv[arg]) == ERROR) {
+        return ERROR;
+    }
+    arg++;
+
+    char **paths = NULL;
+    size_t count = 0, capacity = 0;
+    int status = SUCCESS;
+    for (; arg < argc && status == SUCCESS; arg++) {
+        status = add_path(&paths, &count, &capacity, argv[arg]);
+    }
+
+    // no candidates on the command line means the list comes from a file or stdin
+    if (status == SUCCESS && (list_path != NULL || count == 0)) {
+        int fd = STDIN_FILENO;
+        if (list_path != NULL && strcmp(list_path, STDIN_PATH) != 0) {
+            fd = open(list_path, O_RDONLY);
+        }
+        if (fd == ERROR) {
+            status = ERROR;
+        } else {
+            status = read_path_list(fd, &paths, &count, &capacity);
+            if (fd != STDIN_FILENO) {
+                close(fd);
+            }
+        }
+    }
+
+    CompareStatus *results = NULL;
+    if (status == SUCCESS && count > 0) {
+        results = malloc(count * sizeof(CompareStatus));
+        if (results == NULL) {
+            status = ERROR;
+        }
+    }
+
+    if (status == SUCCESS && count > 0) {
+        BatchJob job = { &expected, paths, results, &tolerance, count, 0, PTHREAD_MUTEX_INITIALIZER };
+
+        if ((size_t) jobs > count) {
+            jobs = count;
+        }
+        pthread_t *threads = malloc((jobs - 1) * sizeof(pthread_t));
+        int started = 0;
+        while (threads != NULL && started < jobs - 1 &&
+               pthread_create(&threads[started], NULL, batch_worker, &job) == 0) {
+            started++;
+        }
+        // the main thread works too, so the batch finishes even if no thread could be started
+        batch_worker(&job);
+        for (int i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+        pthread_mutex_destroy(&job.lock);
+
+        for (size_t i = 0; i < count; i++) {
+            printf("%s,%s\n", paths[i], get_status_name(results[i]));
+        }
+        fflush(stdout);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (paths[i] != NULL) {
+            free(paths[i]);
+        }
+    }
+    free(paths);
+    free(results);
+    free_expected(&expected);
+    return status;
+}
+
+void *batch_worker(void *arg) {
+    BatchJob *job = arg;
+    while (TRUE) {
+        pthread_mutex_lock(&job->lock);
+        size_t index = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (index >= job->count) {
+            return NULL;
+        }
+        job->results[index] = compare_to_expected(job->expected, job->paths[index], job->tolerance);
+    }
+}
+
+CompareStatus compare_to_expected(ExpectedFile *expected, char *file_path, Tolerance *tolerance) {
+    OpenFile file;
+    if (open_file(&file, file_path) == ERROR) {
+        return ERROR;
+    }
+
+    CompareStatus result = DIFFERENT;
+    if (is_identical_to(&file, expected)) {
+        result = IDENTICAL;
+    } else if (file.failed || reset_file(&file) == ERROR) {
+        result = ERROR;
+    } else if (tolerance->enabled) {
+        // the token pass decides in one read, the similar pass is only a fallback
+        Tokenizer expected_tokens, file_tokens;
+        init_buffer_tokenizer(&expected_tokens, expected->data, expected->len);
+        if (init_tokenizer(&file_tokens, file.fd) == ERROR) {
+            result = ERROR;
+        } else {
+            result = are_within_tolerance(&expected_tokens, &file_tokens, tolerance);
+            if (result == DIFFERENT) {
+                if (reset_file(&file) == ERROR) {
+                    result = ERROR;
+                } else {
+                    rewind_tokenizer(&expected_tokens);
+                    rewind_tokenizer(&file_tokens);
+                    result = are_similar_tokens(&expected_tokens, &file_tokens);
+                }
+            }
+            free_tokenizer(&file_tokens);
+        }
+    } else if (is_similar_to(&file, expected)) {
+        result = SIMILAR;
+    } else if (file.failed) {
+        result = ERROR;
+    }
+
+    close(file.fd);
+    return result;
+}
+
+bool is_identical_to(OpenFile *file, ExpectedFile *expected) {
+    if (!have_same_size(file->fd, expected->len)) {
+        return FALSE;
+    }
+
+    size_t offset = 0;
+    ssize_t byte_count;
+    // compare a whole cache block at a time against the expected data
+    while ((byte_count = read(file->fd, file->cache, CACHE_SIZE)) > 0) {
+        if ((size_t) byte_count > expected->len - offset ||
+            memcmp(file->cache, expected->data + offset, byte_count) != 0) {
+            return FALSE;
+        }
+        offset += byte_count;
+    }
+    file->failed = byte_count == ERROR;
+    return byte_count == 0 && offset == expected->len;
+}
+
+bool is_similar_to(OpenFile *file, ExpectedFile *expected) {
+    char ch;
+    size_t offset = 0;
+    while (read_from_file(file, &ch)) {
+        // ignore spaces and casing, the expected side is already normalized
+        if (isspace(ch)) {
+            continue;
+        }
+        if (offset >= expected->normalized_len || toupper(ch) != expected->normalized[offset]) {
+            return FALSE;
+        }
+        offset++;
+    }
+    return offset == expected->normalized_len;
+}
+
+int load_expected(ExpectedFile *expected, char *file_path) {
+    int fd = open(file_path, O_RDONLY);
+    if (fd == ERROR) {
+        return ERROR;
+    }
+
+    expected->data = NULL;
+    expected->len = 0;
+    expected->normalized = NULL;
+    expected->normalized_len = 0;
+
+    size_t capacity = 0;
+    ssize_t byte_count;
+    do {
+        if (expected->len == capacity) {
+            capacity = capacity == 0 ? CACHE_SIZE : capacity * 2;
+            char *data = realloc(expected->data, capacity);
+            if (data == NULL) {
+                close(fd);
+                free_expected(expected);
+                return ERROR;
+            }
+            expected->data = data;
+        }
+        byte_count = read(fd, expected->data + expected->len, capacity - expected->len);
+        if (byte_count > 0) {
+            expected->len += byte_count;
+        }
+    } while (byte_count > 0);
+    close(fd);
+
+    expected->normalized = malloc(expected->len + 1);
+    if (byte_count == ERROR || expected->normalized == NULL) {
+        free_expected(expected);
+        return ERROR;
+    }
+    for (size_t i = 0; i < expected->len; i++) {
+        if (!isspace(expected->data[i])) {
+            expected->normalized[expected->normalized_len++] = toupper(expected->data[i]);
+        }
+    }
+
+    return SUCCESS;
+}
+
+void free_expected(ExpectedFile *expected) {
+    free(expected->data);
+    free(expected->normalized);
+    expected->data = NULL;
+    expected->normalized = NULL;
+}
+
+// reads newline separated paths from fd, skipping empty lines
+int read_path_list(int fd, char ***paths, size_t *count, size_t *capacity) {
+    OpenFile file = { fd, { 0 }, 0, 0, FALSE };
+    size_t line_capacity = BUF_SIZE;
+    char *line = malloc(line_capacity);
+    if (line == NULL) {
+        return ERROR;
+    }
+
+    size_t len = 0;
+    char ch;
+    bool has_char;
+    do {
+        has_char = read_from_file(&file, &ch);
+        if (has_char && ch != '\n') {
+            // grow the line instead of cutting long paths short, keeping room for the terminator
+            if (len == line_capacity - 1) {
+                char *new_line = realloc(line, line_capacity * 2);
+                if (new_line == NULL) {
+                    free(line);
+                    return ERROR;
+                }
+                line = new_line;
+                line_capacity *= 2;
+            }
+            line[len++] = ch;
+            continue;
+        }
+        // strip a trailing carriage return from CRLF lists
+        if (len > 0 && line[len - 1] == '\r') {
+            len--;
+        }
+        if (len > 0) {
+            line[len] = '\0';
+            if (add_path(paths, count, capacity, line) == ERROR) {
+                free(line);
+                return ERROR;
+            }
+        }
+        len = 0;
+    } while (has_char);
+
+    free(line);
+    return file.failed ? ERROR : SUCCESS;
+}
+
+int add_path(char ***paths, size_t *count, size_t *capacity, char *path) {
+    if (*count == *capacity) {
+        size_t new_capacity = *capacity == 0 ? 64 : *capacity * 2;
+        char **new_paths = realloc(*paths, new_capacity * sizeof(char *));
+        if (new_paths == NULL) {
+            return ERROR;
+        }
+        *paths = new_paths;
+        *capacity = new_capacity;
+    }
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        return ERROR;
+    }
+    (*paths)[(*count)++] = copy;
+    return SUCCESS;
+}
+
+const char *get_status_name(CompareStatus status) {
+    switch (status) {
+        case IDENTICAL: return "IDENTICAL";
+        case DIFFERENT: return "DIFFERENT";
+        case SIMILAR:   return "SIMILAR";
+    }
+
+    return "ERROR";
+}
+
+bool is_tolerance_flag(char *flag) {
+    return strcmp(flag, ABS_EPS_FLAG) == 0 || strcmp(flag, REL_EPS_FLAG) == 0;
+}
+
+int set_tolerance(Tolerance *tolerance, char *flag, char *value) {
+    double eps;
+    if (!parse_number(value, strlen(value), &eps) || eps < 0) {
+        return ERROR;
+    }
+
+    if (strcmp(flag, ABS_EPS_FLAG) == 0) {
+        tolerance->abs_eps = eps;
+    } else {
+        tolerance->rel_eps = eps;
+    }
+    tolerance->enabled = TRUE;
+    return SUCCESS;
+}
+
+// same set as isspace() in the C locale
+static inline bool is_token_space(char ch) {
+    return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
+
+// length of the common prefix of two buffers, compared a word at a time
+static size_t common_prefix(const char *data_1, const char *data_2, size_t len) {
+    size_t pos = 0;
+    unsigned long long word_1, word_2;
+    while (pos + sizeof(word_1) <= len) {
+        memcpy(&word_1, data_1 + pos, sizeof(word_1));
+        memcpy(&word_2, data_2 + pos, sizeof(word_2));
+        if (word_1 != word_2) {
+            break;
+        }
+        pos += sizeof(word_1);
+    }
+    while (pos < len && data_1[pos] == data_2[pos]) {
+        pos++;
+    }
+    return pos;
+}
+
+// every whitespace byte is below '!', a word without such a byte can't end a token
+static inline bool may_hold_space(unsigned long long word) {
+    return ((word - 0x2121212121212121ULL) & ~word & 0x8080808080808080ULL) != 0;
+}
+
+// skips the whole tokens both inputs share byte for byte, they match without tokenizing them.
+// only tokens followed by whitespace count, the one after may still differ or continue in the next block.
+static void skip_common_tokens(Tokenizer *tokenizer_1, Tokenizer *tokenizer_2) {
+    size_t left_1 = tokenizer_1->len - tokenizer_1->pos;
+    size_t left_2 = tokenizer_2->len - tokenizer_2->pos;
+    size_t left = left_1 < left_2 ? left_1 : left_2;
+    const char *data_1 = tokenizer_1->data + tokenizer_1->pos;
+    const char *data_2 = tokenizer_2->data + tokenizer_2->pos;
+
+    // remember where the last whole token ended while comparing forward
+    size_t pos = 0;
+    size_t skip = 0;
+    unsigned long long word_1, word_2;
+    while (pos + sizeof(word_1) <= left) {
+        memcpy(&word_1, data_1 + pos, sizeof(word_1));
+        memcpy(&word_2, data_2 + pos, sizeof(word_2));
+        if (word_1 != word_2) {
+            break;
+        }
+        if (may_hold_space(word_1)) {
+            for (size_t end = pos + sizeof(word_1); end > pos; end--) {
+                if (is_token_space(data_1[end - 1])) {
+                    skip = end;
+                    break;
+                }
+            }
+        }
+        pos += sizeof(word_1);
+    }
+    for (; pos < left && data_1[pos] == data_2[pos]; pos++) {
+        if (is_token_space(data_1[pos])) {
+            skip = pos + 1;
+        }
+    }
+
+    tokenizer_1->pos += skip;
+    tokenizer_2->pos += skip;
+}
+
+// same verdict as the similar check: the text without whitespace has to match, ignoring casing
+CompareStatus are_similar_tokens(Tokenizer *tokenizer_1, Tokenizer *tokenizer_2) {
+    char *token_1 = NULL, *token_2 = NULL;
+    size_t len_1 = 0, len_2 = 0;
+    while (TRUE) {
+        if (len_1 == 0 && len_2 == 0) {
+            skip_common_tokens(tokenizer_1, tokenizer_2);
+        }
+        bool has_token_1 = len_1 > 0 || next_token(tokenizer_1, &token_1, &len_1);
+        bool has_token_2 = len_2 > 0 || next_token(tokenizer_2, &token_2, &len_2);
+        if (tokenizer_1->failed || tokenizer_2->failed) {
+            return ERROR;
+        }
+        if (!has_token_1 || !has_token_2) {
+            return has_token_1 == has_token_2 ? SIMILAR : DIFFERENT;
+        }
+
+        // tokens may be split differently, so compare the overlapping part and keep the rest
+        size_t len = len_1 < len_2 ? len_1 : len_2;
+        size_t same = common_prefix(token_1, token_2, len);
+        while (same < len) {
+            if (toupper((unsigned char) token_1[same]) != toupper((unsigned char) token_2[same])) {
+                return DIFFERENT;
+            }
+            same++;
+            same += common_prefix(token_1 + same, token_2 + same, len - same);
+        }
+        token_1 += len;
+        len_1 -= len;
+        token_2 += len;
+        len_2 -= len;
+    }
+}
+
+// compares the files token by token, numeric tokens only have to be within the tolerance
+CompareStatus are_within_tolerance(Tokenizer *tokenizer_1, Tokenizer *tokenizer_2, Tolerance *tolerance) {
+    char *token_1, *token_2;
+    size_t len_1, len_2;
+    // only look for a run of shared text where the last tokens were the same, numbers that keep
+    // differing would otherwise pay for a prefix scan each
+    bool same_text = TRUE;
+    while (TRUE) {
+        if (same_text) {
+            skip_common_tokens(tokenizer_1, tokenizer_2);
+        }
+        bool has_token_1 = next_token(tokenizer_1, &token_1, &len_1);
+        bool has_token_2 = next_token(tokenizer_2, &token_2, &len_2);
+        if (tokenizer_1->failed || tokenizer_2->failed) {
+            return ERROR;
+        }
+        if (!has_token_1 || !has_token_2) {
+            return has_token_1 == has_token_2 ? SIMILAR : DIFFERENT;
+        }
+        same_text = len_1 == len_2 && memcmp(token_1, token_2, len_1) == 0;
+        if (!same_text && !tokens_match(token_1, len_1, token_2, len_2, tolerance)) {
+            return DIFFERENT;
+        }
+    }
+}
+
+bool tokens_match(char *token_1, size_t len_1, char *token_2, size_t len_2, Tolerance *tolerance) {
+    // same text is always a match, no need to parse it
+    if (len_1 == len_2 && memcmp(token_1, token_2, len_1) == 0) {
+        return TRUE;
+    }
+
+    double value_1, value_2;
+    if (parse_number(token_1, len_1, &value_1) && parse_number(token_2, len_2, &value_2)) {
+        double diff = value_1 > value_2 ? value_1 - value_2 : value_2 - value_1;
+        double abs_1 = value_1 < 0 ? -value_1 : value_1;
+        double abs_2 = value_2 < 0 ? -value_2 : value_2;
+        double largest = abs_1 > abs_2 ? abs_1 : abs_2;
+        return value_1 == value_2 || diff <= tolerance->abs_eps || diff <= tolerance->rel_eps * largest;
+    }
+
+    // other tokens ignore casing, like the similar comparison
+    if (len_1 != len_2) {
+        return FALSE;
+    }
+    for (size_t i = 0; i < len_1; i++) {
+        if (toupper((unsigned char) token_1[i]) != toupper((unsigned char) token_2[i])) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// locale independent parser for [+-]digits[.digits][(e|E)[+-]digits], the whole token must match.
+// keeps the first MAX_MANTISSA_DIGITS significant digits and is accurate to a few ULPs, far below
+// any sane tolerance. values that overflow a double are rejected and compared as text instead.
+bool parse_number(const char *token, size_t len, double *value) {
+    static const double powers_of_ten[MAX_EXACT_POWER + 1] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    size_t pos = 0;
+    bool negative = FALSE;
+    if (pos < len && (token[pos] == '-' || token[pos] == '+')) {
+        negative = token[pos] == '-';
+        pos++;
+    }
+
+    unsigned long long mantissa = 0;
+    int mantissa_digits = 0;
+    int exponent = 0;
+    int digit_count = 0;
+
+    // leading zeros add nothing to the mantissa
+    for (; pos < len && token[pos] == '0'; pos++) {
+        digit_count++;
+    }
+
+    // integer part, digits past the mantissa limit only scale the value
+    for (; pos < len; pos++, digit_count++) {
+        unsigned int digit = (unsigned char) token[pos] - '0';
+        if (digit > 9) {
+            break;
+        }
+        if (mantissa_digits < MAX_MANTISSA_DIGITS) {
+            mantissa = mantissa * 10 + digit;
+            mantissa_digits++;
+        } else {
+            exponent++;
+        }
+    }
+
+    // fraction part, digits past the mantissa limit are dropped
+    if (pos < len && token[pos] == '.') {
+        for (pos++; pos < len; pos++, digit_count++) {
+            unsigned int digit = (unsigned char) token[pos] - '0';
+            if (digit > 9) {
+                break;
+            }
+            if (mantissa_digits < MAX_MANTISSA_DIGITS) {
+                mantissa = mantissa * 10 + digit;
+                // zeros right after the point only move it until the first significant digit
+                mantissa_digits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+
+    if (digit_count == 0) {
+        return FALSE;
+    }
+
+    if (pos < len && (token[pos] == 'e' || token[pos] == 'E')) {
+        pos++;
+        bool negative_exponent = FALSE;
+        if (pos < len && (token[pos] == '-' || token[pos] == '+')) {
+            negative_exponent = token[pos] == '-';
+            pos++;
+        }
+        if (pos >= len) {
+            return FALSE;
+        }
+        int written_exponent = 0;
+        for (; pos < len && token[pos] >= '0' && token[pos] <= '9'; pos++) {
+            // anything this large already over/underflows, stop growing
+            if (written_exponent < MAX_EXPONENT) {
+                written_exponent = written_exponent * 10 + (token[pos] - '0');
+            }
+        }
+        exponent += negative_exponent ? -written_exponent : written_exponent;
+    }
+
+    if (pos != len) {
+        return FALSE;
+    }
+
+    // zero stays zero whatever the exponent
+    if (mantissa == 0) {
+        *value = negative ? -0.0 : 0.0;
+        return TRUE;
+    }
+
+    // scale by up to 1e22 at a time, those powers are exact so each step rounds only once. mantissas
+    // above 2^53 were already rounded above, and larger exponents take several rounded steps.
+    // the exponent is bounded, so this ends in range even after the value over/underflows.
+    double result = (double) mantissa;
+    while (exponent > MAX_EXACT_POWER) {
+        result *= powers_of_ten[MAX_EXACT_POWER];
+        exponent -= MAX_EXACT_POWER;
+    }
+    while (exponent < -MAX_EXACT_POWER) {
+        result /= powers_of_ten[MAX_EXACT_POWER];
+        exponent += MAX_EXACT_POWER;
+    }
+    if (exponent > 0) {
+        result *= powers_of_ten[exponent];
+    } else if (exponent < 0) {
+        result /= powers_of_ten[-exponent];
+    }
+
+    // an infinity would be within any relative tolerance of every number
+    if (result > DBL_MAX) {
+        return FALSE;
+    }
+
+    *value = negative ? -result : result;
+    return TRUE;
+}
+
+int init_tokenizer(Tokenizer *tokenizer, int fd) {
+    tokenizer->data = malloc(TOKEN_BLOCK_SIZE);
+    if (tokenizer->data == NULL) {
+        return ERROR;
+    }
+    tokenizer->fd = fd;
+    tokenizer->len = 0;
+    tokenizer->pos = 0;
+    tokenizer->capacity = TOKEN_BLOCK_SIZE;
+    tokenizer->reached_eof = FALSE;
+    tokenizer->failed = FALSE;
+    tokenizer->owns_data = TRUE;
+    return SUCCESS;
+}
+
+void init_buffer_tokenizer(Tokenizer *tokenizer, char *data, size_t len) {
+    tokenizer->fd = ERROR;
+    tokenizer->data = data;
+    tokenizer->len = len;
+    tokenizer->pos = 0;
+    tokenizer->capacity = len;
+    tokenizer->reached_eof = TRUE;
+    tokenizer->failed = FALSE;
+    tokenizer->owns_data = FALSE;
+}
+
+// starts over from the beginning, the caller seeks the file back first
+void rewind_tokenizer(Tokenizer *tokenizer) {
+    tokenizer->pos = 0;
+    if (tokenizer->fd != ERROR) {
+        tokenizer->len = 0;
+        tokenizer->reached_eof = FALSE;
+    }
+}
+
+void free_tokenizer(Tokenizer *tokenizer) {
+    if (tokenizer->owns_data) {
+        free(tokenizer->data);
+    }
+    tokenizer->data = NULL;
+}
+
+// position of the first whitespace at or after 'pos', or 'len' when there is none
+static size_t find_token_end(const char *data, size_t pos, size_t len) {
+    unsigned long long word;
+    while (TRUE) {
+        while (pos + sizeof(word) <= len) {
+            memcpy(&word, data + pos, sizeof(word));
+            if (may_hold_space(word)) {
+                break;
+            }
+            pos += sizeof(word);
+        }
+        // check the candidate word byte by byte, control characters are false alarms
+        size_t end = pos + sizeof(word) < len ? pos + sizeof(word) : len;
+        for (; pos < end; pos++) {
+            if (is_token_space(data[pos])) {
+                return pos;
+            }
+        }
+        if (pos == len) {
+            return len;
+        }
+    }
+}
+
+// keeps the unfinished token at 'start' and reads the next block after it.
+// returns FALSE at end-of-file, or on a read/allocation error with 'failed' set.
+static bool refill_tokenizer(Tokenizer *tokenizer, size_t start) {
+    if (tokenizer->reached_eof) {
+        return FALSE;
+    }
+
+    size_t kept = tokenizer->len - start;
+    if (kept == tokenizer->capacity) {
+        // a single token fills the whole block, grow it
+        char *data = realloc(tokenizer->data, tokenizer->capacity * 2);
+        if (data == NULL) {
+            tokenizer->reached_eof = TRUE;
+            tokenizer->failed = TRUE;
+            return FALSE;
+        }
+        tokenizer->data = data;
+        tokenizer->capacity *= 2;
+    } else if (start > 0) {
+        memmove(tokenizer->data, tokenizer->data + start, kept);
+    }
+    tokenizer->pos -= start;
+    tokenizer->len = kept;
+
+    ssize_t byte_count = read(tokenizer->fd, tokenizer->data + kept, tokenizer->capacity - kept);
+    if (byte_count <= 0) {
+        tokenizer->reached_eof = TRUE;
+        tokenizer->failed = byte_count == ERROR;
+        return FALSE;
+    }
+    tokenizer->len += byte_count;
+    return TRUE;
+}
+
+// returns FALSE when there are no more tokens, 'token' stays valid until the next call
+bool next_token(Tokenizer *tokenizer, char **token, size_t *token_len) {
+    // skip whitespace, dropping whole blocks of it
+    while (TRUE) {
+        while (tokenizer->pos < tokenizer->len && is_token_space(tokenizer->data[tokenizer->pos])) {
+            tokenizer->pos++;
+        }
+        if (tokenizer->pos < tokenizer->len) {
+            break;
+        }
+        if (!refill_tokenizer(tokenizer, tokenizer->len)) {
+            return FALSE;
+        }
+    }
+
+    size_t start = tokenizer->pos;
+    while (TRUE) {
+        tokenizer->pos = find_token_end(tokenizer->data, tokenizer->pos, tokenizer->len);
+        // the token ended inside the block, or the input ended with it
+        if (tokenizer->pos < tokenizer->len) {
+            break;
+        }
+        if (tokenizer->reached_eof) {
+            break;
+        }
+        // refilling moves the unfinished token to the front of the block
+        bool refilled = refill_tokenizer(tokenizer, start);
+        start = 0;
+        if (!refilled) {
+            break;
+        }
+    }
+
+    *token = tokenizer->data + start;
+    *token_len = tokenizer->pos - start;
+    return TRUE;
 }
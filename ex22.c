@@ -7,17 +7,21 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <sys/wait.h>
+#include <signal.h>
+#include <errno.h>
 
 #define ERROR                -1
 #define SUCCESS              0
 #define MAX_PATH             150
-#define ARGUMENT_COUNT       2
+#define MIN_ARGUMENT_COUNT   2
 #define CACHE_SIZE           1024
 #define BUF_SIZE             1024
 #define EXEC_TIMEOUT_SECONDS 5
 
 #define STUDENT_EXEC_NAME   "a.out"
 #define STUDENT_OUTPUT_NAME "output.txt"
+#define RESULTS_FILE_NAME   "results.csv"
+#define GRADE_ERROR_STATUS  255
 
 typedef struct {
     int fd;
@@ -30,8 +34,16 @@ typedef struct {
     char parent_directory[MAX_PATH];
     char input_file[MAX_PATH];
     char output_file[MAX_PATH];
+    char results_file[MAX_PATH];
 } Config;
 
+// student directories found in one parent directory, shared by every config that uses it
+typedef struct {
+    char *parent_directory;
+    char **students;
+    unsigned int count;
+} Roster;
+
 typedef enum {
     NO_C_FILE = 0,
     COMPILATION_ERROR = 10,
@@ -41,6 +53,13 @@ typedef enum {
     EXCELLENT = 100
 } Grade;
 
+// a single (assignment, student) grading job
+typedef struct {
+    Config *config;
+    char *student;
+    Grade grade;
+} Job;
+
 typedef enum {
     COMPARE_IDENTICAL = 1,
     COMPARE_DIFFERENT,
@@ -63,32 +82,86 @@ const char *get_reason(Grade grade);
 int read_config(Config *config, char *config_path);
 int open_file(OpenFile *file, char *file_path);
 bool read_from_file(OpenFile *file, char *ch);
-int start_testing(Config *config);
+int start_testing(Config *configs, int config_count);
 Grade test_student(Config *config, char *student_name);
 bool find_file(char *dir_path, char *buffer);
 void build_path(char *buffer, char *base_path, char *inner_path);
-int compile_c_file(char *dir_path, char *c_file_name, char *error_file_path);
+void build_results_path(char *buffer, char *config_path, bool with_directory, int index);
+bool is_duplicate_results_file(Config *configs, int config_count, int index);
+int discover_students(Roster *roster, char *parent_directory);
+void free_roster(Roster *roster);
+int run_jobs(Job *jobs, unsigned int job_count);
+pid_t start_job(Job *job);
+int compile_c_file(char *dir_path, char *c_file_name, char *exec_file_name, char *error_file_path);
 int run_exec_file(char *dir_path, char *exec_file_name, char *input_file_path, char *output_file_path, char *error_file_path);
 Grade run_compare(char *error_file_path, char *exec_file_path, char *output_file_path, char *student_output_file_path);
 void write_student_grade(int fd, char *student_name, Grade grade);
 void kill_by_signal();
 
 int main(int argc, char *argv[]) {
-    if (argc != ARGUMENT_COUNT) {
+    if (argc < MIN_ARGUMENT_COUNT) {
         return ERROR;
     }
 
-    Config config;
-    char *config_path = argv[1];
-    if (read_config(&config, config_path) == ERROR) {
+    int config_count = argc - 1;
+    Config *configs = malloc(config_count * sizeof(Config));
+    if (configs == NULL) {
+        print_error("Error in: malloc()\n");
         return ERROR;
     }
 
-    if (start_testing(&config) == ERROR) {
+    for (int i = 0; i < config_count; i++) {
+        char *config_path = argv[i + 1];
+        if (read_config(&configs[i], config_path) == ERROR) {
+            free(configs);
+            return ERROR;
+        }
+
+        // a single config keeps the plain results file, several configs get one file each
+        if (config_count == 1) {
+            strncpy(configs[i].results_file, RESULTS_FILE_NAME, MAX_PATH - 1);
+            configs[i].results_file[MAX_PATH - 1] = '\0';
+        } else {
+            build_results_path(configs[i].results_file, config_path, FALSE, 0);
+        }
+    }
+
+    // configs sharing a file name (hw1/config.txt, hw2/config.txt) are told apart by their directory
+    bool *needs_directory = calloc(config_count, sizeof(bool));
+    if (needs_directory == NULL) {
+        print_error("Error in: calloc()\n");
+        free(configs);
         return ERROR;
     }
+    for (int i = 0; i < config_count; i++) {
+        needs_directory[i] = is_duplicate_results_file(configs, config_count, i);
+    }
+    for (int i = 0; i < config_count; i++) {
+        if (needs_directory[i]) {
+            build_results_path(configs[i].results_file, argv[i + 1], TRUE, 0);
+        }
+    }
 
-    return SUCCESS;
+    // anything still the same gets its argument position as well
+    for (int i = 0; i < config_count; i++) {
+        if (is_duplicate_results_file(configs, config_count, i)) {
+            build_results_path(configs[i].results_file, argv[i + 1], needs_directory[i], i + 1);
+        }
+    }
+    free(needs_directory);
+
+    // should never happen, but never let two assignments overwrite each other's results
+    for (int i = 0; i < config_count; i++) {
+        if (is_duplicate_results_file(configs, config_count, i)) {
+            print_error("Duplicate results file name\n");
+            free(configs);
+            return ERROR;
+        }
+    }
+
+    int status = start_testing(configs, config_count);
+    free(configs);
+    return status;
 }
 
 Grade test_student(Config *config, char *student_name) {
@@ -101,15 +174,21 @@ Grade test_student(Config *config, char *student_name) {
         return NO_C_FILE;
     }
 
-    if (compile_c_file(current_directory, c_file, "errors.txt") != SUCCESS) {
+    // jobs for several assignments may share a student directory, so prefix the files with our pid
+    char exec_file_name[MAX_PATH];
+    snprintf(exec_file_name, MAX_PATH, "%d_%s", getpid(), STUDENT_EXEC_NAME);
+    char output_file_name[MAX_PATH];
+    snprintf(output_file_name, MAX_PATH, "%d_%s", getpid(), STUDENT_OUTPUT_NAME);
+
+    if (compile_c_file(current_directory, c_file, exec_file_name, "errors.txt") != SUCCESS) {
         return COMPILATION_ERROR;
     }
 
     // set up paths for student output and executable files
     char student_output_file_path[MAX_PATH];
-    build_path(student_output_file_path, current_directory, STUDENT_OUTPUT_NAME);
+    build_path(student_output_file_path, current_directory, output_file_name);
     char exec_file_path[MAX_PATH];
-    build_path(exec_file_path, current_directory, STUDENT_EXEC_NAME);
+    build_path(exec_file_path, current_directory, exec_file_name);
 
     int exec_status = run_exec_file(current_directory, exec_file_path, config->input_file, student_output_file_path, "errors.txt");
     if (remove(exec_file_path) == ERROR) {
@@ -118,6 +197,8 @@ Grade test_student(Config *config, char *student_name) {
     }
 
     if (exec_status != SUCCESS) {
+        // the pid prefixed output would otherwise be left behind in the student directory
+        remove(student_output_file_path);
         return TIMEOUT;
     }
 
@@ -147,7 +228,7 @@ Grade run_compare(char *error_file_path, char *exec_file_path, char *output_file
 
     if (pid == 0) {
         // child process
-        int fd = open(error_file_path, O_WRONLY | O_CREAT, 0666);
+        int fd = open(error_file_path, O_WRONLY | O_CREAT | O_APPEND, 0666);
         if (fd == ERROR) {
             print_error("Error in: open()\n");
             exit(ERROR);
@@ -222,7 +303,7 @@ int run_exec_file(char *dir_path, char *exec_file_path, char *input_file_path, c
 
     if (pid == 0) {
         // child process
-        int fd_error = open(error_file_path, O_WRONLY | O_CREAT, 0666);
+        int fd_error = open(error_file_path, O_WRONLY | O_CREAT | O_APPEND, 0666);
         int fd_input = open(input_file_path, O_RDONLY);
         int fd_output = open(output_file_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
         if (fd_error == ERROR || fd_input == ERROR || fd_output == ERROR) {
@@ -274,7 +355,7 @@ int run_exec_file(char *dir_path, char *exec_file_path, char *input_file_path, c
 }
 
 // function to compile a C file and store any errors in an error file
-int compile_c_file(char *dir_path, char *c_file_name, char *error_file_path) {
+int compile_c_file(char *dir_path, char *c_file_name, char *exec_file_name, char *error_file_path) {
     pid_t pid = fork();
     if (pid == ERROR) {
         print_error("Error in: fork()\n");
@@ -283,7 +364,7 @@ int compile_c_file(char *dir_path, char *c_file_name, char *error_file_path) {
 
     if (pid == 0) {
         // Child process
-        int fd = open(error_file_path, O_WRONLY | O_CREAT, 0666);
+        int fd = open(error_file_path, O_WRONLY | O_CREAT | O_APPEND, 0666);
         if (fd == ERROR) {
             print_error("Error in: open()\n");
             exit(ERROR);
@@ -307,7 +388,7 @@ int compile_c_file(char *dir_path, char *c_file_name, char *error_file_path) {
         char c_file_path[MAX_PATH] = { 0 };
         build_path(c_file_path, dir_path, c_file_name);
         char out_file_path[MAX_PATH] = { 0 };
-        build_path(out_file_path, dir_path, STUDENT_EXEC_NAME);
+        build_path(out_file_path, dir_path, exec_file_name);
         
         // Set up arguments for the gcc compiler
         char *compile_argv[] = {
@@ -370,39 +451,286 @@ bool find_file(char *dir_path, char *buffer) {
     return FALSE;
 }
 
-// Function to start testing the students' code based on the given configuration
-int start_testing(Config *config) {
-    // Open the parent directory containing student directories
-    DIR *dir = opendir(config->parent_directory);
-    if (dir == NULL) {
-        return ERROR;
+// Function to build a per-assignment results file name from the config file name
+// results_[<directory>_]<config name>[_<index>].csv, the optional parts tell same-named configs apart
+void build_results_path(char *buffer, char *config_path, bool with_directory, int index) {
+    char *base_name = strrchr(config_path, '/');
+    base_name = base_name != NULL ? base_name + 1 : config_path;
+
+    // drop the config file extension, if any
+    char *extension = strrchr(base_name, '.');
+    size_t name_len = extension != NULL && extension != base_name ? (size_t) (extension - base_name) : strlen(base_name);
+    if (name_len > MAX_PATH) {
+        name_len = MAX_PATH;
+    }
+
+    // the directory right above the config, "." and ".." say nothing about the assignment
+    size_t dir_len = 0;
+    char *dir_name = base_name;
+    if (with_directory) {
+        char *dir_end = base_name;
+        while (dir_end > config_path && dir_end[-1] == '/') {
+            dir_end--;
+        }
+        dir_name = dir_end;
+        while (dir_name > config_path && dir_name[-1] != '/') {
+            dir_name--;
+        }
+        dir_len = dir_end - dir_name;
+        if ((dir_len == 1 && dir_name[0] == '.') || (dir_len == 2 && strncmp(dir_name, "..", 2) == 0)) {
+            dir_len = 0;
+        }
+        if (dir_len > MAX_PATH) {
+            dir_len = MAX_PATH;
+        }
+    }
+
+    char index_suffix[BUF_SIZE] = "";
+    if (index > 0) {
+        snprintf(index_suffix, BUF_SIZE, "_%d", index);
     }
 
-    // Create and open a CSV file to store the results
-    int fd_csv = open("results.csv", O_CREAT | O_TRUNC | O_RDWR, 0666);
-    if (fd_csv == ERROR) {
-        closedir(dir);
+    snprintf(buffer, MAX_PATH, "results_%.*s%s%.*s%s.csv",
+             (int) dir_len, dir_name, dir_len > 0 ? "_" : "", (int) name_len, base_name, index_suffix);
+}
+
+// Function to check if another config writes to the same results file
+bool is_duplicate_results_file(Config *configs, int config_count, int index) {
+    for (int i = 0; i < config_count; i++) {
+        if (i != index && strcmp(configs[i].results_file, configs[index].results_file) == 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// Function to collect the student directories of a parent directory
+int discover_students(Roster *roster, char *parent_directory) {
+    DIR *dir = opendir(parent_directory);
+    if (dir == NULL) {
         return ERROR;
     }
 
+    roster->parent_directory = parent_directory;
+    roster->students = NULL;
+    roster->count = 0;
+    unsigned int capacity = 0;
+
     struct dirent *entry = NULL;
     // Iterate through the directory entries
     while ((entry = readdir(dir))) {
         // Check if the entry is a valid student directory
         bool is_directory = entry->d_type == DT_DIR;
         bool is_legal_directory = strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
-        if (is_directory && is_legal_directory) {
-            // Test the student's code and store the result in the CSV file
-            char *dir_name = entry->d_name;
-            Grade grade = test_student(config, dir_name);
-            if (grade != ERROR) {
-                write_student_grade(fd_csv, dir_name, grade);
+        if (!is_directory || !is_legal_directory) {
+            continue;
+        }
+
+        if (roster->count == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            char **students = realloc(roster->students, capacity * sizeof(char *));
+            if (students == NULL) {
+                closedir(dir);
+                free_roster(roster);
+                return ERROR;
             }
+            roster->students = students;
         }
+
+        roster->students[roster->count] = strdup(entry->d_name);
+        if (roster->students[roster->count] == NULL) {
+            closedir(dir);
+            free_roster(roster);
+            return ERROR;
+        }
+        roster->count++;
     }
-    
+
     closedir(dir);
-    close(fd_csv);
+    return SUCCESS;
+}
+
+// Function to free the student names held by a roster
+void free_roster(Roster *roster) {
+    for (unsigned int i = 0; i < roster->count; i++) {
+        free(roster->students[i]);
+    }
+    free(roster->students);
+    roster->students = NULL;
+    roster->count = 0;
+}
+
+// Function to fork a worker process that grades a single job and exits with the grade
+pid_t start_job(Job *job) {
+    pid_t pid = fork();
+    if (pid == ERROR) {
+        print_error("Error in: fork()\n");
+        return ERROR;
+    }
+
+    if (pid == 0) {
+        // child process
+        Grade grade = test_student(job->config, job->student);
+        exit(grade == ERROR ? GRADE_ERROR_STATUS : grade);
+    }
+
+    return pid;
+}
+
+// Function to run all jobs, keeping one worker process per CPU busy until every job is done
+int run_jobs(Job *jobs, unsigned int job_count) {
+    long max_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_workers < 1) {
+        max_workers = 1;
+    }
+
+    pid_t *worker_pids = malloc(max_workers * sizeof(pid_t));
+    unsigned int *worker_jobs = malloc(max_workers * sizeof(unsigned int));
+    if (worker_pids == NULL || worker_jobs == NULL) {
+        print_error("Error in: malloc()\n");
+        free(worker_pids);
+        free(worker_jobs);
+        return ERROR;
+    }
+
+    unsigned int next_job = 0;
+    long running = 0;
+    while (next_job < job_count || running > 0) {
+        // fill every free worker slot with the next pending job
+        while (running < max_workers && next_job < job_count) {
+            jobs[next_job].grade = ERROR;
+            pid_t pid = start_job(&jobs[next_job]);
+            if (pid == ERROR) {
+                break;
+            }
+            worker_pids[running] = pid;
+            worker_jobs[running] = next_job;
+            running++;
+            next_job++;
+        }
+
+        if (running == 0) {
+            // fork failed and no worker will free a slot, so this job can never run
+            free(worker_pids);
+            free(worker_jobs);
+            return ERROR;
+        }
+
+        // wait for any worker to finish and record its grade
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid == ERROR && errno == EINTR) {
+            continue;
+        }
+        if (pid == ERROR) {
+            print_error("Error in: waitpid()\n");
+            free(worker_pids);
+            free(worker_jobs);
+            return ERROR;
+        }
+
+        for (long i = 0; i < running; i++) {
+            if (worker_pids[i] != pid) {
+                continue;
+            }
+            if (WIFEXITED(status) && WEXITSTATUS(status) != GRADE_ERROR_STATUS) {
+                jobs[worker_jobs[i]].grade = WEXITSTATUS(status);
+            }
+            // move the last worker into the freed slot
+            running--;
+            worker_pids[i] = worker_pids[running];
+            worker_jobs[i] = worker_jobs[running];
+            break;
+        }
+    }
+
+    free(worker_pids);
+    free(worker_jobs);
+    return SUCCESS;
+}
+
+// Function to start testing the students' code of every configuration
+int start_testing(Config *configs, int config_count) {
+    // scan each distinct parent directory only once
+    Roster *rosters = malloc(config_count * sizeof(Roster));
+    Roster **config_rosters = malloc(config_count * sizeof(Roster *));
+    if (rosters == NULL || config_rosters == NULL) {
+        print_error("Error in: malloc()\n");
+        free(rosters);
+        free(config_rosters);
+        return ERROR;
+    }
+
+    int roster_count = 0;
+    int status = SUCCESS;
+    unsigned int job_count = 0;
+    for (int i = 0; i < config_count && status == SUCCESS; i++) {
+        config_rosters[i] = NULL;
+        for (int j = 0; j < roster_count; j++) {
+            if (strcmp(rosters[j].parent_directory, configs[i].parent_directory) == 0) {
+                config_rosters[i] = &rosters[j];
+                break;
+            }
+        }
+
+        if (config_rosters[i] == NULL) {
+            if (discover_students(&rosters[roster_count], configs[i].parent_directory) == ERROR) {
+                status = ERROR;
+                break;
+            }
+            config_rosters[i] = &rosters[roster_count];
+            roster_count++;
+        }
+        job_count += config_rosters[i]->count;
+    }
+
+    // build every (assignment, student) job so they all share the same scheduler
+    Job *jobs = NULL;
+    if (status == SUCCESS && job_count > 0) {
+        jobs = malloc(job_count * sizeof(Job));
+        if (jobs == NULL) {
+            print_error("Error in: malloc()\n");
+            status = ERROR;
+        }
+    }
+
+    if (status == SUCCESS) {
+        unsigned int job = 0;
+        for (int i = 0; i < config_count; i++) {
+            for (unsigned int j = 0; j < config_rosters[i]->count; j++) {
+                jobs[job].config = &configs[i];
+                jobs[job].student = config_rosters[i]->students[j];
+                jobs[job].grade = ERROR;
+                job++;
+            }
+        }
+        status = run_jobs(jobs, job_count);
+    }
+
+    // write each assignment's grades to its own CSV file, in discovery order
+    unsigned int job = 0;
+    for (int i = 0; i < config_count && status == SUCCESS; i++) {
+        int fd_csv = open(configs[i].results_file, O_CREAT | O_TRUNC | O_RDWR, 0666);
+        if (fd_csv == ERROR) {
+            status = ERROR;
+            break;
+        }
+
+        for (unsigned int j = 0; j < config_rosters[i]->count; j++, job++) {
+            if (jobs[job].grade != ERROR) {
+                write_student_grade(fd_csv, jobs[job].student, jobs[job].grade);
+            }
+        }
+        close(fd_csv);
+    }
+
+    for (int i = 0; i < roster_count; i++) {
+        free_roster(&rosters[i]);
+    }
+    free(rosters);
+    free(config_rosters);
+    free(jobs);
+    return status;
 }
 
 // Function to open a file and store the file descriptor and related information in the OpenFile structure